@@ -15,7 +15,11 @@
  *
  * INTERNAL DATASTRUCTS
  * Two data structs make up the allocator. The pool-struct and the 
- * freelist. Both are initialized by mem_init() 
+ * freelist. Both are initialized by mem_init() at the start of the heap,
+ * or by mem_init_meta() in a separate metadata buffer. The allocation
+ * counters (Alloccou) are statistics only and are compiled in with
+ * -DMEM_STATS. They are then kept in their own array right after the
+ * pool-struct, so their updates hit the cache lines next to <fbcou>.
  * pool-struct: Is an array of struct's describing the freelist
  * Example of an initialized pool-struct array: DATAWIDTH=16
  * mem_init is called with <heapsize>i = 2000 and <minsize> = 16
@@ -74,20 +78,35 @@ typedef unsigned long long  uint64; // Adapt to your 64 bit unsigned datatype
 	#define MASKaa	0xaaaaaaaaaaaaaaaa
 	#define DATAWIDTH_EXPONENT 6
 #endif
-struct pd {   // heap memory pool descriptor
+#ifndef CACHELINE
+	#define CACHELINE 64	// Cache line size in bytes. Must be a power of two!!
+#endif
+struct pd {   // heap memory pool descriptor - only fields used by alloc/free
+              // Four uint's - a power of 2, so entries never straddle a cache line
   uint  size;   // Size of memory block in powers of 2
   uint  offset; // Offset in uint's from beginning of freelist
   uint  avail;  // number of available memory blocks of size
-	uint	alloccou;	// Number of allocations
 	uint	fbcou;	// Free buddy count. 0=No free buddies > 0 number of free buddies
 								// Used to reduce allocation processing time, by avoiding looking
 								// for free buddies when there are none.
 };
 typedef struct pd pooldesc;
+struct ar {   // Region/bump arena - one header in front of each chained buddy block
+  struct ar *next;  // Next buddy block in the arena chain. 0=last block
+  struct ar *cur;   // First block only: block currently bumped from
+  uint  size;       // Size of this buddy block in bytes (incl. header)
+  uint  used;       // Bytes handed out from this block (incl. header)
+};
+typedef struct ar arena;
+#define ARENA_ALIGN sizeof(uint64)	// Alignment of memory handed out by arenas
+#define ARENA_HEADER ((sizeof(arena) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
 // Global variables
 void *heapstart; // Start of heap-memory to allocate from
 pooldesc *pool;
 uint  *freelist;
+#ifdef MEM_STATS
+uint  *alloccou;	// Number of allocations per pool-structure entry (statistics)
+#endif
 
 ////////////////////////////////// UTILITY FUNCTIONS //////////////////////////
 // Calculate power of 2 for number.
@@ -234,7 +253,77 @@ uint fl_bit_state( uint *fl, uint bitnr ) {
    return(0);
  }
 
+// Function: pool_build
+// Abstract: Build pool-structure, freelist and allocation counters in <meta>
+//           with block sizes from <minsize> up to <maxsize>.
+//           Layout in <meta>: | pool[] | alloccou[] (MEM_STATS only) | freelist[] |
+//           Sets the global <pool>, <alloccou> and <freelist> pointers.
+// Returns number of bytes used from <meta>
+uint pool_build( uint heapsize, uint8 *meta, uint minsize, uint maxsize ) {
+	uint i;
+	uint offsetcou;
+
+	// Step 1: Build pool-structure describing the binary-twin allocation system
+	pool = (pooldesc *) meta;
+	// Fill pool structure. Use minsize as variable to increase alloc-size
+	for ( i = 0, offsetcou = 0; minsize != 0 && minsize <= maxsize; i++, minsize*=2 ) {
+		pool[i].size 		= minsize;		// Size of allocation chunk
+		pool[i].offset 	= offsetcou;	// Freelist array member where <size> freelist starts
+		pool[i].avail		= heapsize / minsize;	// Number of available chunks of minsize bytes
+		pool[i].fbcou		= 0;					// No free buddies available
+		if ( pool[i].avail % 2 != 0 ) {	// Any free buddies?
+			// If uneven number of available buddies, there are one free buddy
+			pool[i].fbcou=1;
+		}
+		// Calculate  how many uint's used in array for freelist
+		offsetcou = offsetcou + pool[i].avail / DATAWIDTH;
+		if ( pool[i].avail % DATAWIDTH != 0 )	{ // if avail not a hole fraction of DATAWIDTH
+			offsetcou +=1; 		// Last arraymember describe last bits in freelist
+		}
+	}
+	// End of pool descriptor. Zero terminate it.
+	// No reason for pool structure for one bit. (top level)
+	pool[i].size 		= 0;
+	pool[i].offset 	= 0;
+	pool[i].avail 	= 0;
+	pool[i].fbcou 	= 1;	// Set to odd number to simplify allocation of memory
+
+	// Step 2: Freelist begins rigth after pool structure. <offsetcou> is now the
+	//         number of uint's in the freelist. Allocation counters are updated
+	//         together with <fbcou>, so they are placed next to the pool structure.
+#ifdef MEM_STATS
+	alloccou = (uint *) &pool[i+1];
+	freelist = &alloccou[i+1];
+	for ( ; i > 0; i-- ) {
+		alloccou[i] = 0;
+	}
+	alloccou[0] = 0;
+#else
+	freelist = (uint *) &pool[i+1];
+#endif
+	for ( i = 0; pool[i].size != 0; i++ ) {
+		fill_bits_in_array( &freelist[ pool[i].offset ], pool[i].avail,0); // Set all chunks free
+	}
+	return( (uint8 *) &freelist[offsetcou] - meta );
+}
+
 ////////////////////////////////// PUBLIC FUNCTIONS //////////////////////////
+// Function: mem_meta_size
+// Status  : public
+// Abstract: Calculate size of the pool-structure, freelist and allocation
+//           counters for a heap. Used to size the buffer for mem_init_meta()
+// Returns		 - Number of bytes needed (excluding CACHELINE alignment)
+uint mem_meta_size( uint heapsize, uint minsize ) {
+	uint levels, flsize;
+	for ( levels = 0, flsize = 0; minsize != 0 && minsize <= heapsize; levels++, minsize*=2 ) {
+		flsize += (heapsize / minsize + DATAWIDTH - 1) / DATAWIDTH;
+	}
+#ifdef MEM_STATS
+	flsize += levels+1;	// Allocation counters
+#endif
+	return( sizeof(pooldesc) * (levels+1) + sizeof(uint) * flsize );
+}
+
 // Function: mem_init
 // Status  : public
 // Abstract: Initialize structures for malloc()/new() memory allocator
@@ -253,7 +342,7 @@ uint mem_init(uint heapsize, uint8 *heap, uint minsize) {
 	// heap.
 	// Step 1: Build pool-structure describing the binary-twin allocation system
 	//         Clear the binary-twin freelist
-	// Step 3: Allocate the pool-structure and the freelist in the freelist
+	// Step 2: Allocate the pool-structure and the freelist in the freelist
 	heapstart = heap;		// Initialise global heap start pointer
 	// Heapsize must be bigger or equal to minsize
 	if (  heapsize < minsize ) {
@@ -262,47 +351,10 @@ uint mem_init(uint heapsize, uint8 *heap, uint minsize) {
 	if ( i = exp_of_2( minsize) == 0 ) {
 		return(0); // Error - minsize not a power of 2
 	}
-	// Allocate pooldescriptor in heap start (reserved later)
+	// Step 1: Build pool-structure in heap start (reserved later)
+	offsetcou = pool_build( heapsize, heap, minsize, heapsize / 2 );
 
-	// Step 1: Build pool-structure describing the binary-twin allocation system
-	pool = (pooldesc *) heap;
-	// Fill pool structure. Use minsize as variable to increase alloc-size
-	for ( i = 0, offsetcou = 0; minsize*2 <= heapsize; i++, minsize*=2 ) {
-		pool[i].size 		= minsize;		// Size of allocation chunk
-		pool[i].offset 	= offsetcou;	// Freelist array member where <size> freelist starts
-		pool[i].avail		= heapsize / minsize;	// Number of available chunks of minsize bytes
-		pool[i].fbcou		= 0;					// No free buddies available
-		if ( pool[i].avail % 2 != 0 ) {	// Any free buddies?
-			// If uneven number of available buddies, there are one free buddy
-			pool[i].fbcou=1;
-		}
-		// Calculate  how many uint's used in array for freelist
-		offsetcou = offsetcou + pool[i].avail / DATAWIDTH;
-		if ( (j = pool[i].avail % DATAWIDTH) != 0 )	{ // if avail not a hole fraction of DATAWIDTH
-			offsetcou +=1; 		// Last arraymember describe last bits in freelist
-		}
-	}
-	// End of pool descriptor. Zero terminate it.
-	// No reason for pool structure for one bit. (top level)
-	pool[i].size 		= 0;
-	pool[i].offset 	= 0;
-	pool[i].avail 	= 0;
-	pool[i].fbcou 	= 1;	// Set to odd number to simplify allocation of memory
-	pool[i].alloccou= 0;
-
-	// Calculate beginning of freelist rigth after pool structure		 
-	freelist =  (uint *) &pool[i+1].size;	// Freelist begin after poll structrure
-	// Initialize freelist with information from pool structure
-	for ( i = 0; pool[i].size != 0; i++ ) {
-		j = fill_bits_in_array( &freelist[ pool[i].offset ], pool[i].avail,0); // Set all chunks free
-	}
-	// Exiting this loop i = zero terminated pool struct entry. j = number of array elements used
-  // by fill_bits_in_array in freelist.
-	//Calculate size of poll-structure + freelist - The used memory must be reserved in freelist!
-	offsetcou = sizeof(*pool)* (i+1);	// First calculate size of pool structure
-	offsetcou = offsetcou + pool[i-1].offset *sizeof(uint) + j * sizeof(uint);	// Then add freelist size
-	//offsetcou=offsetcou*2;
-	// Now reserve memory used for pool structure and freelist
+	// Step 2: Now reserve memory used for pool structure and freelist
 	for( i = 1, j = 0; pool[j].size != 0 ; j++) {
 		if ( offsetcou <= pool[j].size ) {
 			//HETHfreelist[ pool[j].offset] = freelist[ pool[j].offset] | 1 << (DATAWIDTH - 1);
@@ -310,12 +362,48 @@ uint mem_init(uint heapsize, uint8 *heap, uint minsize) {
 			//if ( pool[j].avail != 3 ) {	// Only one fbcou free - when two reserved.
 				pool[j].fbcou+=1;		// One free buddy available, when reserving one block.
 			//}
-			pool[j].alloccou = i;
+#ifdef MEM_STATS
+			alloccou[j] = i;
+#endif
 			i=0;	// <alloccou> only counted up on the first - setting i=0 avoid remaining..
 		}
 	}			
 	return(offsetcou);
 }
+
+// Function: mem_init_meta
+// Status  : public
+// Abstract: Initialize allocator with metadata out-of-band. The pool-structure
+//           and freelist are placed in <meta> (Example: fast on-chip RAM) and
+//           the complete heap is available for allocation. Blocks are
+//           naturally aligned to their size if <heap> is aligned to the
+//           biggest block size.
+// Input:
+//  <heapsize> - The size of RAM in bytes the allocator can allocate
+//  <heap>     - Start address of RAM size if <heapsize>
+//  <minsize>  - Minumium size to be allocated. Must be a power of 2
+//  <meta>     - Start address of metadata buffer. Aligned up to CACHELINE
+//  <metasize> - Size of <meta>. Must be at least mem_meta_size() + CACHELINE-1
+// Returns		 - Number of bytes used from <*meta> or 0 on error
+uint mem_init_meta(uint heapsize, uint8 *heap, uint minsize, uint8 *meta, uint metasize) {
+	uint pad;
+
+	heapstart = heap;		// Initialise global heap start pointer
+	if (  heapsize < minsize ) {
+		return(0);	// Error - heapsize too small
+	}
+	if ( exp_of_2( minsize) == 0 ) {
+		return(0); // Error - minsize not a power of 2
+	}
+	// Start pool-structure on a cache line, so hot entries never straddle lines
+	pad = (CACHELINE - (uint) ((unsigned long) meta % CACHELINE)) % CACHELINE;
+	if ( metasize < pad || metasize - pad < mem_meta_size( heapsize, minsize ) ) {
+		return(0); // Error - metadata buffer too small
+	}
+	// Nothing is reserved in the heap, so the top level must be a single block
+	// (avail=1) that is always a free buddy - else the top pair is unreachable
+	return( pad + pool_build( heapsize, meta + pad, minsize, heapsize ) );
+}
 // Function: mem_rmalloc()
 // Abstract: Resilient malloc. Use rmalloc() for datastructures that have a long life.
 //           rmalloc() allocates memory from begginning of the heap and normal malloc
@@ -334,7 +422,9 @@ void *mem_alloc( uint16 size ) {
 	if ( pool[size_match].fbcou > 0 ) {
 		buddy = fl_find_buddy( (uint *) freelist + pool[size_match].offset, pool[size_match].avail);
 		pool[size_match].fbcou--;		// One less buddy 
-		pool[size_match].alloccou++;// One more allocation of this size
+#ifdef MEM_STATS
+		alloccou[size_match]++;		// One more allocation of this size
+#endif
 		return( (uint8 *) heapstart + pool[size_match].size * (buddy-1) );
 	}
 	// No free buddy found. Need to find bigger block to divide info preferred size.
@@ -376,7 +466,9 @@ void *mem_alloc( uint16 size ) {
 			break;
 		}
 	}
-		pool[size_match].alloccou++;	// One free buddy 
+#ifdef MEM_STATS
+		alloccou[size_match]++;	// One more allocation of this size
+#endif
 	return( (uint8 *) heapstart + pool[size_match].size *( buddy-1) );
 }
 // function: fl_free_buddy
@@ -413,7 +505,9 @@ void mem_free( void *poi ) {
 	for ( i = 0; pool[i].size != 0; i++ ) {
 		bitnr = (  ( (uint8 *) poi -  (uint8 *) heapstart ) / pool[i].size);
 		if ( (j = fl_bit_state( &freelist[ pool[i].offset], bitnr)) != 0 ) {	
-			pool[i].alloccou--;
+#ifdef MEM_STATS
+			alloccou[i]--;
+#endif
 			break;
 		}
 	}
@@ -429,3 +523,126 @@ void mem_free( void *poi ) {
 		pool[i].fbcou--;
 	}
 } 
+
+// Function: pool_block_size
+// Abstract: Find the size of the buddy block mem_alloc() will return for <size>
+// Returns 0 if <size> is too big for any pool or for mem_alloc()
+uint pool_block_size( uint size ) {
+	uint i;
+	for ( i = 0; pool[i].size < size && pool[i].size != 0; i++);
+	if ( pool[i].size > (uint16) -1 ) {
+		return(0);	// mem_alloc() takes a uint16 size - block would be truncated
+	}
+	return( pool[i].size );
+}
+
+////////////////////////////////// ARENA FUNCTIONS ///////////////////////////
+// A region (bump) arena is carved from one or more buddy blocks. Each block
+// starts with an <arena> header. Memory is handed out by bumping <used> in the
+// current block, so an allocation costs a few instructions and no freelist
+// updates. All memory in the arena is released at once by mem_arena_reset()
+// or mem_arena_destroy() - there is no per-object free.
+//
+//  +--------+------+------+---....     +--------+------+---....
+//  | header | obj1 | obj2 |  free      | header | obj3 |  free
+//  +--------+------+------+---....     +--------+------+---....
+//   first block (handle) -- next -->    chained block
+//
+// Example: a request handler allocates its temporary objects with
+//          mem_arena_alloc() and calls mem_arena_reset() when done.
+
+// Function: mem_arena_create
+// Status  : public
+// Abstract: Create an arena from one buddy block able to hold <size> bytes
+// Returns 0 if no buddy block could be allocated, else the arena handle
+arena *mem_arena_create( uint size ) {
+	arena *a;
+	uint blocksize;
+
+	if ( size > (uint) -1 - ARENA_HEADER ) {
+		return(0);	// Requested size too big - would overflow
+	}
+	size += ARENA_HEADER;	// Header is placed in front of the user memory
+	if ( (blocksize = pool_block_size( size )) == 0 ) {
+		return(0);	// Requested size too big
+	}
+	if ( (a = (arena *) mem_alloc( blocksize )) == 0 ) {
+		return(0);	// No free memory
+	}
+	a->next = 0;
+	a->cur  = a;
+	a->size = blocksize;
+	a->used = ARENA_HEADER;
+	return( a );
+}
+
+// Function: mem_arena_alloc
+// Status  : public
+// Abstract: Allocate <size> bytes from arena <a> by pointer bumping.
+//           When the current block is full, the next block in the chain is
+//           used, or a new buddy block is allocated and chained.
+// Returns 0 if no memory available, else pointer aligned to ARENA_ALIGN
+void *mem_arena_alloc( arena *a, uint size ) {
+	arena *c;
+	uint blocksize;
+	void *poi;
+
+	if ( size > (uint) -1 - ARENA_HEADER - (ARENA_ALIGN - 1) ) {
+		return(0);	// Requested size too big - would overflow
+	}
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	c = a->cur;
+	if ( c->size - c->used < size ) {
+		// Current block full - try blocks kept in the chain by mem_arena_reset()
+		while ( c->next != 0 ) {
+			c = c->next;
+			c->used = ARENA_HEADER;
+			if ( c->size - c->used >= size ) {
+				break;
+			}
+		}
+		if ( c->size - c->used < size ) {
+			// No room in the chain - allocate a new buddy block at least as big
+			// as the first block and chain it at the end
+			if ( (blocksize = pool_block_size( size + ARENA_HEADER )) == 0 ) {
+				return(0);	// Requested size too big
+			}
+			if ( blocksize < a->size ) {
+				blocksize = a->size;
+			}
+			if ( (c->next = (arena *) mem_alloc( blocksize )) == 0 ) {
+				return(0);	// No free memory
+			}
+			c = c->next;
+			c->next = 0;
+			c->cur  = 0;
+			c->size = blocksize;
+			c->used = ARENA_HEADER;
+		}
+		a->cur = c;
+	}
+	poi = (uint8 *) c + c->used;
+	c->used += size;
+	return( poi );
+}
+
+// Function: mem_arena_reset
+// Status  : public
+// Abstract: Release all memory allocated from arena <a> in O(1).
+//           Chained buddy blocks are kept and reused by mem_arena_alloc().
+void mem_arena_reset( arena *a ) {
+	a->cur  = a;
+	a->used = ARENA_HEADER;
+}
+
+// Function: mem_arena_destroy
+// Status  : public
+// Abstract: Return all buddy blocks of arena <a> to the allocator.
+//           The arena handle is invalid afterwards.
+void mem_arena_destroy( arena *a ) {
+	arena *next;
+	for ( ; a != 0; a = next ) {
+		next = a->next;
+		mem_free( a );
+	}
+}
@@ -37,18 +37,42 @@ typedef unsigned long long  uint64; // Adapt to your 64 bit unsigned datatype
 	#define MASKaa	0xaaaaaaaaaaaaaaaa
 	#define DATAWIDTH_EXPONENT 6
 #endif
-struct pd {   // heap memory pool descriptor
+#ifndef CACHELINE
+	#define CACHELINE 64	// Cache line size in bytes. Must be a power of two!!
+#endif
+struct pd {   // heap memory pool descriptor - only fields used by alloc/free
+              // Four uint's - a power of 2, so entries never straddle a cache line
    uint  size;   // Size of memory block in powers of 2
    uint  offset; // Offset in uint's from beginning of freelist
    uint  avail;  // number of available memory blocks of size
-   uint  alloccou; // Number of allocations
    uint  fbcou;  // Free buddy count. 0=No free buddies > 0 number of free buddies
                  // Used to reduce allocation processing time, by avoiding looking
                  // for free buddies when there are none.
  };
  typedef struct pd pooldesc;
+struct ar {   // Region/bump arena - one header in front of each chained buddy block
+  struct ar *next;  // Next buddy block in the arena chain. 0=last block
+  struct ar *cur;   // First block only: block currently bumped from
+  uint  size;       // Size of this buddy block in bytes (incl. header)
+  uint  used;       // Bytes handed out from this block (incl. header)
+};
+typedef struct ar arena;
+#define ARENA_ALIGN sizeof(uint64)	// Alignment of memory handed out by arenas
+#define ARENA_HEADER ((sizeof(arena) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
  // Global variables
  void *heapstart; // Start of heap-memory to allocate from
  pooldesc *pool;
  uint  *freelist;
-
+ #ifdef MEM_STATS
+ uint  *alloccou;	// Number of allocations per pool-structure entry (statistics)
+ #endif
+ // Public functions
+ uint  mem_init(uint heapsize, uint8 *heap, uint minsize);
+ uint  mem_init_meta(uint heapsize, uint8 *heap, uint minsize, uint8 *meta, uint metasize);
+ uint  mem_meta_size( uint heapsize, uint minsize );
+ void *mem_alloc( uint16 size );
+ void  mem_free( void *poi );
+ arena *mem_arena_create( uint size );
+ void *mem_arena_alloc( arena *a, uint size );
+ void  mem_arena_reset( arena *a );
+ void  mem_arena_destroy( arena *a );
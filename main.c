@@ -56,6 +56,9 @@
 ////////////////////////// TESTING ////////////////////////////
 #define HEAPSIZE 4096   // Size of heap memory
 #define MINSIZE  16      // Minumiim size in bytes to be allocatd
+#ifdef MEM_META
+uint8 meta[512];	// Metadata buffer for mem_init_meta() (Example: on-chip RAM)
+#endif
 double time_pair, time_buddy; //DEBUG
  clock_t start_pair,start_buddy; //DEBUG
  uint counter; // DEBUG
@@ -93,10 +96,12 @@ void printpooldesc( void ) {
 	for ( i = 0; pool[i].size != 0 ; i++ ) {
 	  printf("%d\t",pool[i].fbcou);
 	}
+#ifdef MEM_STATS
 	printf("\nAlloccou:\t");
 	for ( i = 0; pool[i].size != 0 ; i++ ) {
-	  printf("%d\t",pool[i].alloccou);
+	  printf("%d\t",alloccou[i]);
 	}
+#endif
 	printf("\n");
 }
 
@@ -115,11 +120,16 @@ char *buf = (char *) malloc( MEMSIZE );
 char clr[] = {0x1b,'[','2' ,'J',0,0x1b,'[','H'};
 double *arr[1000000];
 void *mem;
+arena *ar;
 time_pair=0;
 time_buddy=0;
 counter=0;
 //#define MEMSIZE 65535*1024
+#ifdef MEM_META	// Metadata out-of-band: gcc -DMEM_META ...
+if ( (i=mem_init_meta( MEMSIZE, (uint8 *) buf, MINSIZE, meta, sizeof(meta)) ) == 0 ) {
+#else
 if ( (i=mem_init( MEMSIZE, (uint8 *) buf, MINSIZE) ) == 0 ) {
+#endif
 //if ( i== 0 ) {
 	printf("mem_init failed\n");
 	return(0);
@@ -207,6 +217,39 @@ mem_free( arr[i-1] );
 }
 printf("TOTAL: %d\n",j);
 printpooldesc();
+
+printf("================================ ARENA ========================================\n");
+ar = mem_arena_create( 200 );
+for ( i = 0; ar != 0 && i < 100; i++ ) {
+	arr[i] = mem_arena_alloc( ar, sizeof(double) );
+	if ( arr[i] == 0 ) {
+		printf("\nArena allocation returned 0 i=%d!!!!!!!!!!!!\n",i);
+		break;
+	}
+	*arr[i] = i;
+}
+for ( j = 0; j < i; j++ ) {
+	if ( *arr[j] != (double)j ) {
+		printf("ARENA DATA WRONG.... should be %d are %d\n", j, (int) *arr[j]);
+	}
+}
+printf("Arena allocations: %d\n",i);
+printpooldesc();
+// Requests bigger than any pool must fail - not overrun the block
+if ( mem_arena_alloc( ar, MEMSIZE ) != 0 || mem_arena_create( (uint) -8 ) != 0 ) {
+	printf("ARENA OVERSIZE WRONG....\n");
+}
+// After reset the same chained blocks must be reused in the same order
+mem_arena_reset( ar );
+for ( j = 0; j < i; j++ ) {
+	if ( mem_arena_alloc( ar, sizeof(double) ) != (void *) arr[j] ) {
+		printf("ARENA RESET WRONG.... allocation %d not reused\n", j);
+		break;
+	}
+}
+printpooldesc();
+mem_arena_destroy( ar );
+printpooldesc();
 free( buf );
 return 1;
 }